@@ -1,8 +1,11 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
 #include <initializer_list>
 #include <iostream>
 #include <iterator>
 #include <list>
+#include <memory>
 #include <stdexcept>
 #include <utility>
 #include <vector>
@@ -11,29 +14,57 @@ namespace MyHashTable {
 
 template <class KeyType, class ValueType, class Hash = std::hash<KeyType>>
 class HashMap {
+    using Bucket = std::list<std::pair<const KeyType, ValueType>>;
+
+    // Узел дерева сегментов: лист хранит до segment_size_ списков, внутренний
+    // узел - до fanout_ детей. Узел с generation, отличным от generation_
+    // таблицы, может быть разделён со снимком или копией и копируется при записи.
+    struct Node {
+        size_t generation = 0;
+        std::vector<std::shared_ptr<Node>> children;
+        std::vector<Bucket> buckets;
+    };
+
+    // Положение элемента: индекс списка (capacity_, если ключа нет), лист с
+    // этим списком и итератор на элемент в нём.
+    struct Position {
+        size_t index;
+        const std::shared_ptr<Node> *leaf;
+        typename Bucket::iterator inter_it;
+    };
+
 public:
     class iterator;
     class const_iterator;
+    class Snapshot;
 
     // 1. Конструктор по умолчанию.
 
     explicit HashMap(const Hash &hash_func = Hash())
         : size_(0), capacity_(start_capacity_), hash_func_(hash_func) {
-        table_.resize(capacity_);
+        reset_root();
     }
 
+    // Копирование за O(1): узлы разделяются с other и копируются по одному
+    // пути от корня при первой записи в любую из таблиц.
     HashMap(const HashMap &other)
         : size_(other.size_),
           capacity_(other.capacity_),
+          depth_(other.depth_),
+          generation_(other.generation_.fetch_add(1) + 1),
+          version_(0),
           hash_func_(other.hash_func_),
-          table_(other.table_) {
+          root_(other.root_) {
     }
 
     HashMap(HashMap &&other)
         : size_(std::exchange(other.size_, 0)),
           capacity_(std::exchange(other.capacity_, 0)),
+          depth_(std::exchange(other.depth_, 0)),
+          generation_(other.generation_.load()),
+          version_(other.version_),
           hash_func_(std::exchange(other.hash_func_, Hash())),
-          table_(std::exchange(other.table_, {})) {
+          root_(std::exchange(other.root_, {})) {
     }
 
     HashMap &operator=(const HashMap &other) {
@@ -55,7 +86,7 @@ public:
     template <class input_iterator>
     HashMap(input_iterator begin, input_iterator end, const Hash &hash_func = Hash())
         : size_(0), capacity_(start_capacity_), hash_func_(hash_func) {
-        table_.resize(capacity_);
+        reset_root();
         while (begin != end) {
             insert(*begin);
             ++begin;
@@ -67,7 +98,7 @@ public:
     HashMap(std::initializer_list<std::pair<KeyType, ValueType>> list,
             const Hash &hash_func = Hash())
         : size_(0), capacity_(start_capacity_), hash_func_(hash_func) {
-        table_.resize(capacity_);
+        reset_root();
         for (auto &elem : list) {
             insert(elem);
         }
@@ -92,104 +123,84 @@ public:
     // 7. Метод insert
 
     void insert(std::pair<KeyType, ValueType> elem) {
-        if (find(elem.first) != end()) {
+        Position pos = locate(elem.first);
+        if (pos.index != capacity_) {
             return;
         }
+        const std::shared_ptr<Node> *node = pos.leaf;
         if (size_ * 1.0 >= capacity_ * load_factor_) {
             rehash();
+            node = &leaf(hash_func_(elem.first) % capacity_);
         }
         size_t index = hash_func_(elem.first) % capacity_;
+        const std::shared_ptr<Node> *home = node;
         size_ += 1;
         for (size_t i = 0; i < neighborhood_; ++i) {
-            if (table_[(index + i) % capacity_].empty()) {
-                table_[(index + i) % capacity_].push_back(elem);
+            size_t probe_index = (index + i) % capacity_;
+            node = &probe(probe_index, *node);
+            if ((*node)->buckets[probe_index & segment_mask_].empty()) {
+                writable_bucket(probe_index, *node).push_back(elem);
                 return;
             }
         }
-        table_[index].push_back(elem);
+        writable_bucket(index, *home).push_back(elem);
     }
 
     // 8. Метод erase
 
     void erase(KeyType key) {
-        if (find(key) == end()) {
+        Position pos = locate(key);
+        if (pos.index == capacity_) {
             return;
         }
-        size_t index = hash_func_(key) % capacity_;
         size_ -= 1;
-        for (size_t i = 0; i < neighborhood_; ++i) {
-            if (!table_[(index + i) % capacity_].empty() &&
-                table_[(index + i) % capacity_].front().first == key) {
-                table_[(index + i) % capacity_].pop_front();
-                break;
-            }
-        }
-        for (typename std::list<std::pair<const KeyType, ValueType>>::iterator it =
-                 table_[index].begin();
-             it != table_[index].end(); ++it) {
-            if (it->first == key) {
-                table_[index].erase(it);
-                break;
-            }
-        }
+        detach(pos);
+        (*pos.leaf)->buckets[pos.index & segment_mask_].erase(pos.inter_it);
     }
 
     // 10. Метод find, константный (возвращающий const_iterator) и нет
-    // (возвращающий iterator)
+    // (возвращающий iterator). cfind ищет без записи и для неконстантной таблицы.
 
     iterator find(KeyType key) {
-        size_t index = hash_func_(key) % capacity_;
-        for (size_t i = 0; i < neighborhood_; ++i) {
-            if (!table_[(index + i) % capacity_].empty() &&
-                table_[(index + i) % capacity_].front().first == key) {
-                return iterator(table_, (index + i) % capacity_,
-                                table_[(index + i) % capacity_].begin());
-            }
-        }
-        for (auto it = table_[index].begin(); it != table_[index].end(); ++it) {
-            if (it->first == key) {
-                return iterator(table_, index, it);
-            }
+        Position pos = locate(key);
+        if (pos.index == capacity_) {
+            return end();
         }
-        return end();
+        return iterator(*this, pos.index, *pos.leaf, pos.inter_it);
     }
 
     const_iterator find(KeyType key) const {
-        size_t index = hash_func_(key) % capacity_;
-        for (size_t i = 0; i < neighborhood_; ++i) {
-            if (!table_[(index + i) % capacity_].empty() &&
-                table_[(index + i) % capacity_].front().first == key) {
-                return const_iterator(table_, (index + i) % capacity_,
-                                      table_[(index + i) % capacity_].begin());
-            }
+        Position pos = locate(key);
+        if (pos.index == capacity_) {
+            return end();
         }
-        for (auto it = table_[index].begin(); it != table_[index].end(); ++it) {
-            if (it->first == key) {
-                return const_iterator(table_, index, it);
-            }
-        }
-        return end();
+        return const_iterator(*this, pos.index, *pos.leaf, pos.inter_it);
+    }
+
+    const_iterator cfind(KeyType key) const {
+        return find(key);
     }
 
     // 11. Оператор [ ]
 
     ValueType &operator[](KeyType key) {
-        iterator it = find(key);
-        if (it == end()) {
+        Position pos = locate(key);
+        if (pos.index == capacity_) {
             insert({key, ValueType()});
+            pos = locate(key);
         }
-        it = find(key);
-        return it->second;
+        detach(pos);
+        return pos.inter_it->second;
     }
 
     // 12. Константный метод at
 
     const ValueType &at(KeyType key) const {
-        const_iterator it = find(key);
-        if (it == end()) {
+        Position pos = locate(key);
+        if (pos.index == capacity_) {
             throw std::out_of_range("This key does not exist");
         }
-        return it->second;
+        return pos.inter_it->second;
     }
 
     // 13. Метод clear
@@ -202,43 +213,61 @@ public:
     void swap(HashMap &other) {
         std::swap(size_, other.size_);
         std::swap(capacity_, other.capacity_);
+        std::swap(depth_, other.depth_);
+        generation_.store(other.generation_.exchange(generation_.load()));
         std::swap(hash_func_, other.hash_func_);
-        std::swap(table_, other.table_);
+        std::swap(root_, other.root_);
+        ++version_;
+        ++other.version_;
+    }
+
+    // 14. Метод snapshot
+    // Снимок создаётся за O(1) и не меняется при последующих изменениях
+    // таблицы. Первая запись в сегмент после снимка копирует этот сегмент
+    // (segment_size_ списков) и O(log) внутренних узлов на пути к нему; чтение
+    // ничего не копирует. Снимок можно читать из другого потока, пока владелец
+    // изменяет таблицу. Разыменование неконстантного iterator считается
+    // записью и отделяет его сегмент, поэтому читать живую таблицу после снимка
+    // нужно через cbegin, cend и cfind: они ничего не копируют.
+
+    Snapshot snapshot() const {
+        return Snapshot(*this);
     }
 
     // 9.1 iterator
+    // Итератор удерживает сегмент, по которому идёт, поэтому остаётся
+    // корректным после копирования таблицы и видит последующие записи в неё.
+    // При разыменовании сегмент отделяется от снимков и копий.
 
     class iterator {
     public:
         iterator() = default;
 
-        iterator(std::vector<std::list<std::pair<const KeyType, ValueType>>> &table,
-                 size_t list_index,
-                 typename std::list<std::pair<const KeyType, ValueType>>::iterator inter_it)
-            : table_(&table), list_index_(list_index), inter_it_(inter_it) {
+        iterator(HashMap &map, size_t list_index, std::shared_ptr<Node> leaf,
+                 typename Bucket::iterator inter_it)
+            : map_(&map),
+              list_index_(list_index),
+              version_(map.version_),
+              leaf_(std::move(leaf)),
+              inter_it_(inter_it) {
         }
 
         std::pair<const KeyType, ValueType> &operator*() {
+            detach();
             return *inter_it_;
         }
 
         std::pair<const KeyType, ValueType> *operator->() {
+            detach();
             return inter_it_.operator->();
         }
 
         iterator &operator++() {
-            if (list_index_ == table_->size() - 1 && inter_it_ == (*table_)[list_index_].end()) {
+            if (!leaf_) {
                 throw std::out_of_range("invalid iterator");
             }
-            ++inter_it_;
-            if (inter_it_ != (*table_)[list_index_].end() || list_index_ == table_->size() - 1) {
-                return *this;
-            }
-            ++list_index_;
-            while ((*table_)[list_index_].empty() && list_index_ != table_->size() - 1) {
-                ++list_index_;
-            }
-            inter_it_ = (*table_)[list_index_].begin();
+            map_->refresh(list_index_, leaf_, inter_it_, version_);
+            map_->advance(list_index_, leaf_, inter_it_);
             return *this;
         }
 
@@ -249,8 +278,8 @@ public:
         }
 
         bool operator==(const iterator &other) const {
-            return table_ == other.table_ && list_index_ == other.list_index_ &&
-                   inter_it_ == other.inter_it_;
+            return map_ == other.map_ && list_index_ == other.list_index_ &&
+                   (!leaf_ || inter_it_->first == other.inter_it_->first);
         }
 
         bool operator!=(const iterator &other) const {
@@ -258,57 +287,67 @@ public:
         }
 
     private:
-        std::vector<std::list<std::pair<const KeyType, ValueType>>> *table_;
-        size_t list_index_;
-        typename std::list<std::pair<const KeyType, ValueType>>::iterator inter_it_;
+        void detach() {
+            Position pos{list_index_, &leaf_, inter_it_};
+            map_->detach(pos);
+            leaf_ = *pos.leaf;
+            inter_it_ = pos.inter_it;
+            version_ = map_->version_;
+        }
+
+        HashMap *map_ = nullptr;
+        size_t list_index_ = 0, version_ = 0;
+        std::shared_ptr<Node> leaf_;
+        typename Bucket::iterator inter_it_;
     };
 
     iterator begin() {
         size_t index = 0;
-        while (table_[index].empty() && index != capacity_ - 1) {
-            ++index;
+        std::shared_ptr<Node> node;
+        skip_empty(index, node);
+        if (!node) {
+            return end();
         }
-        return iterator(table_, index, table_[index].begin());
+        auto inter_it = node->buckets[index & segment_mask_].begin();
+        return iterator(*this, index, std::move(node), inter_it);
     }
 
     iterator end() {
-        return iterator(table_, capacity_ - 1, table_.back().end());
+        return iterator(*this, capacity_, nullptr, {});
     }
 
     // 9.2 const_iterator
+    // Перед чтением переходит в текущий сегмент таблицы, если тот был заменён.
 
     class const_iterator {
     public:
         const_iterator() = default;
 
-        const_iterator(
-            const std::vector<std::list<std::pair<const KeyType, ValueType>>> &table,
-            size_t list_index,
-            typename std::list<std::pair<const KeyType, ValueType>>::const_iterator inter_it)
-            : table_(&table), list_index_(list_index), inter_it_(inter_it) {
+        const_iterator(const HashMap &map, size_t list_index, std::shared_ptr<Node> leaf,
+                       typename Bucket::const_iterator inter_it)
+            : map_(&map),
+              list_index_(list_index),
+              version_(map.version_),
+              leaf_(std::move(leaf)),
+              inter_it_(inter_it) {
         }
 
         const std::pair<const KeyType, ValueType> &operator*() {
+            map_->refresh(list_index_, leaf_, inter_it_, version_);
             return *inter_it_;
         }
 
         const std::pair<const KeyType, ValueType> *operator->() {
+            map_->refresh(list_index_, leaf_, inter_it_, version_);
             return inter_it_.operator->();
         }
 
         const_iterator &operator++() {
-            if (list_index_ == table_->size() - 1 && inter_it_ == (*table_)[list_index_].end()) {
+            if (!leaf_) {
                 throw std::out_of_range("invalid iterator");
             }
-            ++inter_it_;
-            if (inter_it_ != (*table_)[list_index_].end() || list_index_ == table_->size() - 1) {
-                return *this;
-            }
-            ++list_index_;
-            while ((*table_)[list_index_].empty() && list_index_ != table_->size() - 1) {
-                ++list_index_;
-            }
-            inter_it_ = (*table_)[list_index_].begin();
+            map_->refresh(list_index_, leaf_, inter_it_, version_);
+            map_->advance(list_index_, leaf_, inter_it_);
             return *this;
         }
 
@@ -319,8 +358,8 @@ public:
         }
 
         bool operator==(const const_iterator &other) const {
-            return table_ == other.table_ && list_index_ == other.list_index_ &&
-                   inter_it_ == other.inter_it_;
+            return map_ == other.map_ && list_index_ == other.list_index_ &&
+                   (!leaf_ || inter_it_->first == other.inter_it_->first);
         }
 
         bool operator!=(const const_iterator &other) const {
@@ -328,45 +367,279 @@ public:
         }
 
     private:
-        const std::vector<std::list<std::pair<const KeyType, ValueType>>> *table_;
-        size_t list_index_;
-        typename std::list<std::pair<const KeyType, ValueType>>::const_iterator inter_it_;
+        const HashMap *map_ = nullptr;
+        size_t list_index_ = 0, version_ = 0;
+        std::shared_ptr<Node> leaf_;
+        typename Bucket::const_iterator inter_it_;
     };
 
     const_iterator begin() const {
         size_t index = 0;
-        while (table_[index].empty() && index != capacity_ - 1) {
-            ++index;
+        std::shared_ptr<Node> node;
+        skip_empty(index, node);
+        if (!node) {
+            return end();
         }
-        return const_iterator(table_, index, table_[index].begin());
+        auto inter_it = node->buckets[index & segment_mask_].cbegin();
+        return const_iterator(*this, index, std::move(node), inter_it);
     }
 
     const_iterator end() const {
-        return const_iterator(table_, capacity_ - 1, table_.back().end());
+        return const_iterator(*this, capacity_, nullptr, {});
+    }
+
+    const_iterator cbegin() const {
+        return begin();
+    }
+
+    const_iterator cend() const {
+        return end();
     }
 
 protected:
     void rehash() {
         capacity_ *= 2;
-        std::vector<std::list<std::pair<const KeyType, ValueType>>> temp_table(capacity_);
-        std::swap(table_, temp_table);
+        std::shared_ptr<Node> temp_root = reset_root();
         size_ = 0;
-        for (auto &list : temp_table) {
+        for_each_bucket(*temp_root, [this](const Bucket &list) {
             for (auto &elem : list) {
                 insert(elem);
             }
-        }
+        });
         return;
     }
 
 private:
-    std::vector<std::list<std::pair<const KeyType, ValueType>>> table_;
+    // Заменяет дерево пустым деревом на capacity_ списков, возвращает старый корень.
+    std::shared_ptr<Node> reset_root() {
+        depth_ = 0;
+        while ((size_t(1) << (segment_bits_ + fanout_bits_ * depth_)) < capacity_) {
+            ++depth_;
+        }
+        ++version_;
+        return std::exchange(root_, make_node(capacity_, depth_));
+    }
+
+    std::shared_ptr<Node> make_node(size_t count, size_t level) const {
+        auto node = std::make_shared<Node>();
+        node->generation = generation_.load();
+        if (level == 0) {
+            node->buckets.resize(count);
+            return node;
+        }
+        size_t span = size_t(1) << (segment_bits_ + fanout_bits_ * (level - 1));
+        for (size_t first = 0; first < count; first += span) {
+            node->children.push_back(make_node(std::min(span, count - first), level - 1));
+        }
+        return node;
+    }
+
+    template <class Function>
+    static void for_each_bucket(const Node &node, Function function) {
+        for (auto &child : node.children) {
+            for_each_bucket(*child, function);
+        }
+        for (auto &list : node.buckets) {
+            function(list);
+        }
+    }
+
+    static size_t child_index(size_t index, size_t level) {
+        return (index >> (segment_bits_ + fanout_bits_ * (level - 1))) & fanout_mask_;
+    }
+
+    // Если узел может быть разделён со снимком или копией, заменяет его
+    // собственной копией.
+    void unshare(std::shared_ptr<Node> &node) {
+        size_t generation = generation_.load();
+        if (node->generation == generation) {
+            return;
+        }
+        if (node.use_count() > 1) {
+            node = std::make_shared<Node>(*node);
+            ++version_;
+        } else {
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        node->generation = generation;
+    }
+
+    const std::shared_ptr<Node> &leaf(size_t index) const {
+        const std::shared_ptr<Node> *node = &root_;
+        for (size_t level = depth_; level > 0; --level) {
+            node = &(*node)->children[child_index(index, level)];
+        }
+        return *node;
+    }
+
+    const std::shared_ptr<Node> &mutable_leaf(size_t index) {
+        std::shared_ptr<Node> *node = &root_;
+        unshare(*node);
+        for (size_t level = depth_; level > 0; --level) {
+            node = &(*node)->children[child_index(index, level)];
+            unshare(*node);
+        }
+        return *node;
+    }
+
+    // Список index для записи. Лист текущего поколения уже принадлежит только
+    // этой таблице, и путь к нему заново не проходится.
+    Bucket &writable_bucket(size_t index, const std::shared_ptr<Node> &node) {
+        if (node->generation == generation_.load()) {
+            return node->buckets[index & segment_mask_];
+        }
+        return mutable_leaf(index)->buckets[index & segment_mask_];
+    }
+
+    // Переносит pos в собственный лист таблицы, отделяя его от снимков и копий.
+    void detach(Position &pos) {
+        if ((*pos.leaf)->generation == generation_.load()) {
+            return;
+        }
+        std::shared_ptr<Node> old_leaf = *pos.leaf;
+        pos.leaf = &mutable_leaf(pos.index);
+        if (*pos.leaf != old_leaf) {
+            pos.inter_it =
+                relocate((*pos.leaf)->buckets[pos.index & segment_mask_], pos.inter_it->first);
+        }
+    }
+
+    // Если лист итератора был заменён в таблице, переходит к тому же ключу в
+    // текущем листе.
+    template <class ListIterator>
+    void refresh(size_t index, std::shared_ptr<Node> &node, ListIterator &inter_it,
+                 size_t &version) const {
+        if (!node || version == version_) {
+            return;
+        }
+        version = version_;
+        const std::shared_ptr<Node> &current = leaf(index);
+        if (current != node) {
+            inter_it = relocate(current->buckets[index & segment_mask_], inter_it->first);
+            node = current;
+        }
+    }
+
+    template <class ListIterator>
+    void advance(size_t &index, std::shared_ptr<Node> &node, ListIterator &inter_it) const {
+        ++inter_it;
+        if (inter_it != node->buckets[index & segment_mask_].end()) {
+            return;
+        }
+        skip_empty(++index, node);
+        if (node) {
+            inter_it = node->buckets[index & segment_mask_].begin();
+        }
+    }
+
+    static typename Bucket::iterator relocate(Bucket &list, const KeyType &key) {
+        for (auto it = list.begin(); it != list.end(); ++it) {
+            if (it->first == key) {
+                return it;
+            }
+        }
+        throw std::out_of_range("invalid iterator");
+    }
+
+    // Лист соседнего списка index: заново берётся только на границе сегмента.
+    const std::shared_ptr<Node> &probe(size_t index, const std::shared_ptr<Node> &node) const {
+        return (index & segment_mask_) == 0 ? leaf(index) : node;
+    }
+
+    // Сдвигает index к первому непустому списку, обновляя node на границах
+    // сегментов. Если таких списков нет, index == capacity_ и node пуст.
+    void skip_empty(size_t &index, std::shared_ptr<Node> &node) const {
+        for (; index < capacity_; ++index) {
+            if (!node || (index & segment_mask_) == 0) {
+                node = leaf(index);
+            }
+            if (!node->buckets[index & segment_mask_].empty()) {
+                return;
+            }
+        }
+        node.reset();
+    }
+
+    // Положение key за один спуск по дереву. Если ключа нет, leaf указывает на
+    // лист домашнего списка.
+    Position locate(const KeyType &key) const {
+        size_t index = hash_func_(key) % capacity_;
+        const std::shared_ptr<Node> *home = &leaf(index);
+        const std::shared_ptr<Node> *node = home;
+        for (size_t i = 0; i < neighborhood_; ++i) {
+            size_t probe_index = (index + i) % capacity_;
+            if (i > 0) {
+                node = &probe(probe_index, *node);
+            }
+            Bucket &list = (*node)->buckets[probe_index & segment_mask_];
+            if (!list.empty() && list.front().first == key) {
+                return {probe_index, node, list.begin()};
+            }
+        }
+        Bucket &list = (*home)->buckets[index & segment_mask_];
+        for (auto it = list.begin(); it != list.end(); ++it) {
+            if (it->first == key) {
+                return {index, home, it};
+            }
+        }
+        return {capacity_, home, {}};
+    }
+
+    size_t size_, capacity_, depth_ = 0;
+    mutable std::atomic<size_t> generation_{0};
+    size_t version_ = 0;
     Hash hash_func_;
-    size_t size_, capacity_;
+    std::shared_ptr<Node> root_;
 
     static constexpr size_t neighborhood_ = 6;
     static constexpr size_t start_capacity_ = 24;
+    static constexpr size_t segment_bits_ = 6;
+    static constexpr size_t fanout_bits_ = 6;
+    static constexpr size_t segment_mask_ = (size_t(1) << segment_bits_) - 1;
+    static constexpr size_t fanout_mask_ = (size_t(1) << fanout_bits_) - 1;
     static constexpr double load_factor_ = 0.8;
 };
 
+// Неизменяемый снимок таблицы, возвращаемый HashMap::snapshot
+
+template <class KeyType, class ValueType, class Hash>
+class HashMap<KeyType, ValueType, Hash>::Snapshot {
+public:
+    size_t size() const {
+        return map_.size();
+    }
+
+    bool empty() const {
+        return map_.empty();
+    }
+
+    Hash hash_function() const {
+        return map_.hash_function();
+    }
+
+    const_iterator find(KeyType key) const {
+        return map_.find(key);
+    }
+
+    const ValueType &at(KeyType key) const {
+        return map_.at(key);
+    }
+
+    const_iterator begin() const {
+        return map_.begin();
+    }
+
+    const_iterator end() const {
+        return map_.end();
+    }
+
+private:
+    friend class HashMap;
+
+    explicit Snapshot(const HashMap &map) : map_(map) {
+    }
+
+    HashMap map_;
+};
+
 }  // namespace MyHashTable
\ No newline at end of file
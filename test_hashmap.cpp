@@ -5,6 +5,7 @@
 #include <functional>
 #include <stdexcept>
 #include <map>
+#include <thread>
 
 using namespace MyHashTable;
 
@@ -46,6 +47,24 @@ struct StrangeInt {
 };
 int StrangeInt::counter;
 
+struct CopyCounter {
+    int x;
+    static int copies;
+    CopyCounter() : x(0) {
+    }
+    CopyCounter(int x) : x(x) {
+    }
+    CopyCounter(const CopyCounter& rs) : x(rs.x) {
+        ++copies;
+    }
+    CopyCounter& operator=(const CopyCounter& rs) = default;
+
+    static void init() {
+        copies = 0;
+    }
+};
+int CopyCounter::copies;
+
 namespace std {
 template <>
 struct hash<StrangeInt> {
@@ -282,6 +301,194 @@ void check_move() {
     }
 }
 
+/* check that snapshot doesn't see later modifications */
+void check_snapshot() {
+    std::cerr << "check snapshot...\n";
+    HashMap<int, int> map;
+    for (int i = 0; i < 1000; ++i)
+        map[i] = i;
+    auto snapshot = map.snapshot();
+    static_assert(std::is_same<HashMap<int, int>::const_iterator,
+                               decltype(snapshot.begin())>::value,
+                  "snapshot's 'begin' returns not a const iterator");
+    map[0] = -1;
+    map.erase(1);
+    map.find(2)->second = -2;
+    for (int i = 1000; i < 3000; ++i)
+        map[i] = i;
+    if (snapshot.size() != 1000 || map.size() != 2999)
+        fail("wrong size after snapshot");
+    if (snapshot.at(0) != 0 || snapshot.find(1) == snapshot.end() || snapshot.at(2) != 2)
+        fail("snapshot sees later modifications");
+    if (snapshot.find(1500) != snapshot.end())
+        fail("snapshot sees later insert");
+    if (map.at(0) != -1 || map.find(1) != map.end() || map.at(2) != -2)
+        fail("wrong map after snapshot");
+    size_t count = 0;
+    for (auto cur : snapshot) {
+        if (cur.first != cur.second)
+            fail("wrong element in snapshot");
+        ++count;
+    }
+    if (count != 1000)
+        fail("wrong snapshot iteration");
+    HashMap<int, int> copy(map);
+    copy[0] = 0;
+    if (map.at(0) != -1)
+        fail("copy modifies original");
+    std::cerr << "ok!\n";
+}
+
+/* check that iterators taken before copy or snapshot stay correct */
+void check_iterators_after_copy() {
+    std::cerr << "check iterators after copy...\n";
+    HashMap<int, int> map;
+    for (int i = 0; i < 10; ++i)
+        map[i] = i;
+    {
+        auto it = map.find(5);
+        HashMap<int, int> copy(map);
+        it->second = 42;
+        if (copy.at(5) != 5 || map.at(5) != 42)
+            fail("write through iterator changes copy");
+    }
+    {
+        auto it = map.find(6);
+        auto snapshot = map.snapshot();
+        it->second = 42;
+        if (snapshot.at(6) != 6 || map.at(6) != 42)
+            fail("write through iterator changes snapshot");
+    }
+    {
+        auto it = map.find(7);
+        auto snapshot = map.snapshot();
+        map.erase(8);
+        it->second = 42;
+        if (snapshot.at(7) != 7 || map.at(7) != 42 || snapshot.find(8) == snapshot.end())
+            fail("write through iterator after detach changes snapshot");
+    }
+    {
+        const HashMap<int, int>& const_map = map;
+        auto it = const_map.begin();
+        HashMap<int, int> copy(map);
+        map.erase(9);
+        map.insert(std::make_pair(9, 9));
+        size_t steps = 0;
+        for (; it != const_map.end() && steps < 100; ++it)
+            ++steps;
+        if (steps != 9)
+            fail("const_iterator broken by write after copy");
+    }
+    {
+        auto first = map.find(3);
+        auto second = first;
+        auto snapshot = map.snapshot();
+        first->second = 1;
+        if (first != second || second->second != 1)
+            fail("iterators differ after write through one of them");
+    }
+    {
+        const HashMap<int, int>& const_map = map;
+        auto it = const_map.find(4);
+        auto snapshot = map.snapshot();
+        map[4] = 100;
+        if (it->second != 100 || snapshot.at(4) != 4)
+            fail("const_iterator doesn't see write after snapshot");
+    }
+    {
+        auto it = map.find(5);
+        auto snapshot = map.snapshot();
+        map.erase(5);
+        try {
+            it->second = 1;
+            fail("write through erased iterator doesn't throw");
+        } catch (const std::out_of_range& e) {
+        }
+        if (snapshot.at(5) != 42)
+            fail("snapshot changed by erase");
+    }
+    std::cerr << "ok!\n";
+}
+
+/* check that snapshot shares everything and writes copy only one segment */
+void check_snapshot_copies() {
+    std::cerr << "check snapshot copies...\n";
+    HashMap<int, CopyCounter> map;
+    for (int i = 0; i < 100000; ++i)
+        map.insert(std::make_pair(i, CopyCounter(i)));
+    const HashMap<int, CopyCounter>& const_map = map;
+
+    CopyCounter::init();
+    auto snapshot = map.snapshot();
+    HashMap<int, CopyCounter> copy(map);
+    if (CopyCounter::copies)
+        fail("snapshot or copy copies values");
+
+    for (int i = 0; i < 100000; i += 7) {
+        if (map.find(i) == map.end() || map.cfind(i)->second.x != i || map.at(i).x != i)
+            fail("wrong find after snapshot");
+    }
+    size_t count = 0;
+    for (auto it = map.begin(); it != map.end(); ++it)
+        ++count;
+    for (auto it = map.cbegin(); it != map.cend(); ++it)
+        count += it->second.x == it->first;
+    for (auto& cur : const_map)
+        count += (*const_map.find(cur.first)).second.x == cur.second.x;
+    if (count != 300000)
+        fail("wrong iteration after snapshot");
+    if (CopyCounter::copies)
+        fail("reads after snapshot copy values");
+
+    map.erase(5);
+    if (CopyCounter::copies == 0 || CopyCounter::copies > 64)
+        fail("write after snapshot copies more than one segment");
+    int copies = CopyCounter::copies;
+    map.erase(6);
+    map[7].x = -7;
+    if (CopyCounter::copies != copies)
+        fail("second write to the same segment copies again");
+    map.find(8)->second.x = -8;
+    if (CopyCounter::copies != copies)
+        fail("write through iterator to the same segment copies again");
+    map.find(50000)->second.x = -1;
+    if (CopyCounter::copies - copies > 64)
+        fail("write through iterator copies more than one segment");
+    if (snapshot.at(5).x != 5 || snapshot.at(7).x != 7 || copy.at(7).x != 7 ||
+        snapshot.at(8).x != 8 || snapshot.at(50000).x != 50000)
+        fail("snapshot sees later modifications");
+    std::cerr << "ok!\n";
+}
+
+/* check that snapshot can be read while the map is modified */
+void check_snapshot_concurrent() {
+    std::cerr << "check concurrent snapshot reads...\n";
+    HashMap<int, int> map;
+    for (int i = 0; i < 10000; ++i)
+        map[i] = i;
+    for (int round = 0; round < 10; ++round) {
+        auto snapshot = map.snapshot();
+        bool correct = true;
+        std::thread reader([&snapshot, &correct] {
+            size_t count = 0;
+            for (auto cur : snapshot)
+                count += cur.first < 10000;
+            for (int i = 0; i < 10000; ++i)
+                correct = correct && snapshot.find(i) != snapshot.end();
+            correct = correct && count == 10000;
+        });
+        for (int i = 0; i < 10000; ++i) {
+            map[i] += 1;
+            map.erase(i + 10000);
+            map[i + 10000] = i;
+        }
+        reader.join();
+        if (!correct)
+            fail("snapshot changed under concurrent writes");
+    }
+    std::cerr << "ok!\n";
+}
+
 void run_all() {
     const_check();
     exception_check();
@@ -291,6 +498,10 @@ void run_all() {
     check_copy();
     check_iterators();
     check_move();
+    check_snapshot();
+    check_iterators_after_copy();
+    check_snapshot_copies();
+    check_snapshot_concurrent();
 }
 }  // namespace internal_tests
 